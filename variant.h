@@ -1,6 +1,9 @@
+#pragma once
 #include <iostream>
 #include <variant>
 #include <new>
+#include <cstring>
+#include <algorithm>
 //
 template<typename... Types>
 union VariadicUnion {
@@ -144,6 +147,10 @@ struct index_by_type_impl<N, T, Last> {
 template<typename T, typename... Types>
 static constexpr size_t index_by_type = index_by_type_impl<0, T, Types...>::value;
 
+template<size_t N, typename... Types>
+using alternative_t = std::remove_cv_t<std::remove_reference_t<
+    decltype(std::declval<VariadicUnion<Types...>&>().template get<N>())>>;
+
 template<typename T, typename... Types>
 class VariantAlternative;
 
@@ -168,6 +175,11 @@ const auto& get(const Variant<Types...>& v);
 template<size_t N, typename... Types>
 auto&& get(Variant<Types...>&& v);
 
+template<typename T, typename... Types>
+void uninitialized_construct_n(Variant<Types...>* dst, const T* src, size_t n);
+
+struct VariantUninitialized {};
+
 template<typename... Types>
 struct VariantStorage {
     VariadicUnion<Types...> storage;
@@ -445,6 +457,12 @@ private:
     template<typename T, typename... Ts>
     friend class VariantAlternative; 
 
+    template<typename T, typename... Ts>
+    friend void uninitialized_construct_n(Variant<Ts...>* dst, const T* src, size_t n);
+
+    // Leaves both the payload and the index unset, the caller fills them in.
+    explicit Variant(VariantUninitialized) {}
+
 public:
     using VariantAlternative<Types, Types...>::VariantAlternative...;
     using ::VariantAlternative<Types, Types...>::operator=...;
@@ -453,6 +471,7 @@ public:
     Variant() {
         this->storage.put();    
         this->i = 0;
+        this->valueless = false;
     } 
     
     Variant(const Variant&) = default;
@@ -478,6 +497,7 @@ public:
             this->valueless = false;
             return this->storage.template emplace<N, Args...>(std::forward<Args>(args)...);
         } catch(...) {
+            this->i = sizeof...(Types);
             this->valueless = true;
             throw 1;
         }
@@ -543,3 +563,186 @@ template<typename T, typename... Types>
 T&& get(Variant<Types...>&& v) {
     return get<index_by_type<T, Types...>>(v); 
 }
+
+template<typename Visitor, typename VariantRef, size_t... Is>
+decltype(auto) visit_impl(Visitor&& vis, VariantRef&& v, std::index_sequence<Is...>) {
+    using R = decltype(std::forward<Visitor>(vis)(v.storage.template get<0>()));
+    using Fn = R(*)(Visitor&&, VariantRef&&);
+    static constexpr Fn table[] = {
+        [](Visitor&& f, VariantRef&& var) -> R {
+            return std::forward<Visitor>(f)(var.storage.template get<Is>());
+        }...
+    };
+    if (v.index() >= sizeof...(Is)) {
+        throw std::bad_variant_access();
+    }
+    return table[v.index()](std::forward<Visitor>(vis), std::forward<VariantRef>(v));
+}
+
+template<typename Visitor, typename... Types>
+decltype(auto) visit(Visitor&& vis, Variant<Types...>& v) {
+    return visit_impl(std::forward<Visitor>(vis), v, std::index_sequence_for<Types...>());
+}
+
+template<typename Visitor, typename... Types>
+decltype(auto) visit(Visitor&& vis, const Variant<Types...>& v) {
+    return visit_impl(std::forward<Visitor>(vis), v, std::index_sequence_for<Types...>());
+}
+
+// Checks the hinted alternatives first with a plain compare and a direct
+// call, and only falls back to the table in visit_impl for the rest.
+template<typename R, size_t Hot, size_t... Rest, typename Visitor, typename VariantRef, size_t... Is>
+R visit_hinted_impl(Visitor&& vis, VariantRef&& v, std::index_sequence<Is...> all) {
+    if (v.index() == Hot) {
+        return std::forward<Visitor>(vis)(v.storage.template get<Hot>());
+    }
+    if constexpr (sizeof...(Rest) == 0) {
+        return visit_impl(std::forward<Visitor>(vis), std::forward<VariantRef>(v), all);
+    }
+    else {
+        return visit_hinted_impl<R, Rest...>(std::forward<Visitor>(vis), std::forward<VariantRef>(v), all);
+    }
+}
+
+template<typename... Hot, typename Visitor, typename... Types>
+decltype(auto) visit_hinted(Visitor&& vis, Variant<Types...>& v) {
+    using R = decltype(std::forward<Visitor>(vis)(v.storage.template get<0>()));
+    return visit_hinted_impl<R, index_by_type<Hot, Types...>...>(
+        std::forward<Visitor>(vis), v, std::index_sequence_for<Types...>());
+}
+
+template<typename... Hot, typename Visitor, typename... Types>
+decltype(auto) visit_hinted(Visitor&& vis, const Variant<Types...>& v) {
+    using R = decltype(std::forward<Visitor>(vis)(v.storage.template get<0>()));
+    return visit_hinted_impl<R, index_by_type<Hot, Types...>...>(
+        std::forward<Visitor>(vis), v, std::index_sequence_for<Types...>());
+}
+
+// Bulk operations on arrays of Variant that all end up holding the same
+// alternative T. For trivially copyable T the payload is written with a
+// plain memcpy store and the index bookkeeping is only done for elements
+// that need it.
+//
+// uninitialized_construct_n writes payloads and indices in separate loops
+// over blocks small enough to stay in L1, so the payload loop is a run of
+// stores the compiler can unroll.
+static constexpr size_t bulk_block_size = 64;
+
+// Assignment has to read every index anyway, and on large arrays it is
+// bound by memory. It makes a single pass that checks the indices of two
+// elements with one branch and then stores both payloads, requesting the
+// lines a few dozen elements ahead for writing. A separate pass checking a
+// whole block first was measured slower, since it walks the lines twice.
+static constexpr size_t bulk_prefetch_distance = 64;
+
+template<typename T>
+inline void bulk_prefetch_for_write(const T* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr, 1);
+#else
+    (void)ptr;
+#endif
+}
+
+// Constructs n variants holding copies of src[0..n) in raw storage at dst.
+template<typename T, typename... Types>
+void uninitialized_construct_n(Variant<Types...>* dst, const T* src, size_t n) {
+    constexpr size_t idx = index_by_type<T, Types...>;
+    static_assert(idx < sizeof...(Types), "T is not an alternative of the variant");
+    for (size_t begin = 0; begin < n; begin += bulk_block_size) {
+        size_t end = std::min(n, begin + bulk_block_size);
+        for (size_t k = begin; k < end; ++k) {
+            new (dst + k) Variant<Types...>(VariantUninitialized());
+        }
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            for (size_t k = begin; k < end; ++k) {
+                std::memcpy(&dst[k].storage.template get<idx>(), src + k, sizeof(T));
+            }
+        }
+        else {
+            size_t k = begin;
+            try {
+                for (; k < end; ++k) {
+                    dst[k].storage.template put<T>(src[k]);
+                }
+            } catch(...) {
+                for (size_t j = begin; j < k; ++j) {
+                    dst[j].storage.template destroy<T>();
+                }
+                for (size_t j = 0; j < begin; ++j) {
+                    dst[j].~Variant<Types...>();
+                }
+                throw;
+            }
+        }
+        for (size_t k = begin; k < end; ++k) {
+            dst[k].i = idx;
+            dst[k].valueless = false;
+        }
+    }
+}
+
+template<typename T, typename Source, typename... Types>
+void bulk_assign(Variant<Types...>* dst, size_t n, Source&& source) {
+    constexpr size_t idx = index_by_type<T, Types...>;
+    static_assert(idx < sizeof...(Types), "T is not an alternative of the variant");
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        auto assign_one = [dst, &source](size_t k) {
+            // Only elements holding another alternative need destruct().
+            // Copying T cannot throw, so the index can be switched before
+            // the payload is written.
+            if (dst[k].i != idx) {
+                dst[k].destruct();
+                dst[k].i = idx;
+            }
+            dst[k].valueless = false;
+            std::memcpy(&dst[k].storage.template get<idx>(), &source(k), sizeof(T));
+        };
+        // A moved-from element keeps its index but is marked valueless, so
+        // the fast path checks the flag too; it sits next to the index.
+        auto assign_pair = [dst, &source, &assign_one](size_t k) {
+            if (dst[k].i == idx && !dst[k].valueless && dst[k + 1].i == idx && !dst[k + 1].valueless) {
+                std::memcpy(&dst[k].storage.template get<idx>(), &source(k), sizeof(T));
+                std::memcpy(&dst[k + 1].storage.template get<idx>(), &source(k + 1), sizeof(T));
+            }
+            else {
+                assign_one(k);
+                assign_one(k + 1);
+            }
+        };
+        size_t k = 0;
+        for (; k + bulk_prefetch_distance < n; k += 2) {
+            bulk_prefetch_for_write(dst + k + bulk_prefetch_distance);
+            assign_pair(k);
+        }
+        for (; k + 2 <= n; k += 2) {
+            assign_pair(k);
+        }
+        if (k < n) {
+            assign_one(k);
+        }
+    }
+    else {
+        for (size_t k = 0; k < n; ++k) {
+            if (dst[k].i == idx) {
+                dst[k].storage.template assign<T>(source(k));
+                dst[k].valueless = false;
+            }
+            else {
+                dst[k].template emplace<idx>(source(k));
+            }
+        }
+    }
+}
+
+// Makes dst[k] hold a copy of src[k] for every k in [0, n).
+template<typename T, typename... Types>
+void assign_n(Variant<Types...>* dst, const T* src, size_t n) {
+    bulk_assign<T>(dst, n, [src](size_t k) -> const T& { return src[k]; });
+}
+
+// Makes every one of the n variants at dst hold a copy of value.
+template<typename T, typename... Types>
+void fill_alternative(Variant<Types...>* dst, size_t n, const T& value) {
+    bulk_assign<T>(dst, n, [&value](size_t) -> const T& { return value; });
+}
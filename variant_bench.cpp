@@ -0,0 +1,531 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "variant.h"
+#include "variant_mailbox.h"
+#include "variant_codec.h"
+#include "variant_packed.h"
+#include "variant_interner.h"
+
+// Build with: g++ -std=c++17 -O2 -pthread variant_bench.cpp -o variant_bench
+
+using Clock = std::chrono::steady_clock;
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+template<typename T>
+static void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+namespace mailbox_bench {
+
+struct Tick { int64_t sent_ns; };
+struct Order { int64_t sent_ns; int64_t qty; };
+struct Cancel { int64_t sent_ns; int64_t id; };
+struct Heartbeat { int64_t sent_ns; };
+
+using Box = VariantMailbox<Tick, Order, Cancel, Heartbeat>;
+
+// Latencies are bucketed by powers of two nanoseconds.
+struct Histogram {
+    std::vector<int64_t> buckets = std::vector<int64_t>(40, 0);
+
+    void add(int64_t ns) {
+        size_t b = 0;
+        while (ns > 1 && b + 1 < buckets.size()) {
+            ns >>= 1;
+            ++b;
+        }
+        ++buckets[b];
+    }
+
+    void print() const {
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            if (buckets[b] != 0) {
+                std::cout << "    < " << (int64_t(1) << (b + 1)) << " ns: " << buckets[b] << "\n";
+            }
+        }
+    }
+};
+
+struct Handler {
+    Histogram& hist;
+    int64_t checksum = 0;
+
+    void record(int64_t sent_ns) { hist.add(now_ns() - sent_ns); }
+    void operator()(Tick& t) { record(t.sent_ns); }
+    void operator()(Order& o) { checksum += o.qty; record(o.sent_ns); }
+    void operator()(Cancel& c) { checksum -= c.id; record(c.sent_ns); }
+    void operator()(Heartbeat& h) { record(h.sent_ns); }
+};
+
+// With interval_ns == 0 the producers send as fast as they can, which
+// measures throughput. Otherwise each producer sends one message every
+// interval_ns, well below what the consumer can take, so that the latency
+// histogram shows the hand-off itself rather than the time spent queued.
+static void run(int producers, int64_t per_producer, int64_t interval_ns, bool print_histogram) {
+    Box box(4096);
+    Histogram hist;
+    Handler handler{hist};
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&box, per_producer, interval_ns] {
+            int64_t next_send = now_ns();
+            for (int64_t k = 0; k < per_producer; ++k) {
+                if (interval_ns != 0) {
+                    next_send += interval_ns;
+                    while (now_ns() < next_send) {
+                        std::this_thread::yield();
+                    }
+                }
+                bool ok;
+                do {
+                    switch (k & 3) {
+                        case 0: ok = box.try_emplace<Tick>(Tick{now_ns()}); break;
+                        case 1: ok = box.try_emplace<Order>(Order{now_ns(), k}); break;
+                        case 2: ok = box.try_emplace<Cancel>(Cancel{now_ns(), k}); break;
+                        default: ok = box.try_emplace<Heartbeat>(Heartbeat{now_ns()}); break;
+                    }
+                    if (!ok) {
+                        std::this_thread::yield();
+                    }
+                } while (!ok);
+            }
+        });
+    }
+    int64_t received = 0;
+    size_t max_batch = 0;
+    while (received < producers * per_producer) {
+        size_t n = box.drain(handler, 256);
+        if (n == 0) {
+            std::this_thread::yield();
+        }
+        received += n;
+        max_batch = std::max(max_batch, n);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    do_not_optimize(handler.checksum);
+
+    std::cout << "  producers=" << producers
+              << "  " << received / seconds / 1e6 << " Mmsg/s\n";
+    if (print_histogram) {
+        std::cout << "    largest batch drained (queue depth bound): " << max_batch << "\n";
+        hist.print();
+    }
+}
+
+void Run() {
+    std::cout << "VariantMailbox producer scaling:\n";
+    unsigned max_producers = std::max(2u, std::thread::hardware_concurrency() - 1);
+    for (unsigned p = 1; p <= max_producers && p <= 8; p *= 2) {
+        run(p, 2000000 / p, 0, false);
+    }
+    std::cout << "VariantMailbox latency histogram (1 producer, one message per 5 us):\n";
+    run(1, 200000, 5000, true);
+}
+
+}  // namespace mailbox_bench
+
+namespace dispatch_bench {
+
+template<int N>
+struct Msg { int64_t value; };
+
+using SmallMsg = Msg<0>;
+
+using Wide = Variant<SmallMsg, Msg<1>, Msg<2>, Msg<3>, Msg<4>, Msg<5>, Msg<6>,
+                     Msg<7>, Msg<8>, Msg<9>, Msg<10>, Msg<11>, Msg<12>, Msg<13>,
+                     Msg<14>, Msg<15>, Msg<16>, Msg<17>, Msg<18>, Msg<19>, Msg<20>>;
+
+constexpr size_t alternatives = 21;
+
+struct Sum {
+    int64_t total = 0;
+
+    template<int N>
+    void operator()(const Msg<N>& m) { total += m.value * (N + 1); }
+};
+
+template<size_t... Is>
+static Wide make(size_t idx, int64_t value, std::index_sequence<Is...>) {
+    Wide result;
+    ((idx == Is ? (result.emplace<Is>(Msg<int(Is)>{value}), true) : false) || ...);
+    return result;
+}
+
+static std::vector<Wide> generate(const std::string& distribution, size_t n) {
+    // xorshift keeps the generated sequence identical between runs.
+    uint64_t state = 88172645463325252ull;
+    auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    std::vector<double> cdf(alternatives);
+    double acc = 0;
+    for (size_t k = 0; k < alternatives; ++k) {
+        if (distribution == "uniform") {
+            acc += 1.0;
+        }
+        else if (distribution == "zipf") {
+            acc += 1.0 / double(k + 1);
+        }
+        else {
+            acc += k == 0 ? 0.95 * (alternatives - 1) / 0.05 : 1.0;
+        }
+        cdf[k] = acc;
+    }
+
+    std::vector<Wide> values;
+    values.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        double u = double(next() >> 11) / double(1ull << 53) * acc;
+        size_t idx = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        values.push_back(make(std::min(idx, alternatives - 1), int64_t(i), std::make_index_sequence<alternatives>()));
+    }
+    return values;
+}
+
+template<typename F>
+static void measure(const char* name, const std::vector<Wide>& values, F&& f) {
+    constexpr int rounds = 1000;
+    int64_t checksum = 0;
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        checksum += f(values);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    do_not_optimize(checksum);
+    std::cout << "    " << name << ": "
+              << seconds * 1e9 / (double(rounds) * values.size()) << " ns/value\n";
+}
+
+void Run() {
+    std::cout << "Dispatch over Variant with 21 alternatives:\n";
+    for (const char* distribution : {"uniform", "zipf", "single-hot"}) {
+        auto values = generate(distribution, 1 << 14);
+        std::cout << "  " << distribution << ":\n";
+        measure("visit       ", values, [](const std::vector<Wide>& vs) {
+            Sum sum;
+            for (const auto& v : vs) {
+                visit(sum, v);
+            }
+            return sum.total;
+        });
+        measure("visit_hinted", values, [](const std::vector<Wide>& vs) {
+            Sum sum;
+            for (const auto& v : vs) {
+                visit_hinted<SmallMsg>(sum, v);
+            }
+            return sum.total;
+        });
+    }
+}
+
+}  // namespace dispatch_bench
+
+namespace codec_bench {
+
+template<typename V>
+static std::string make_stream(size_t records) {
+    std::string stream;
+    V v;
+    for (size_t k = 0; k < records; ++k) {
+        switch (k % 3) {
+            case 0: v = static_cast<int64_t>(k); break;
+            case 1: v.template emplace<1>(std::string(16 + k % 48, 'x')); break;
+            default: v = static_cast<double>(k) * 0.5; break;
+        }
+        encode_variant(v, stream);
+    }
+    return stream;
+}
+
+template<typename V, typename Decode>
+static void measure(const char* name, const std::string& stream, Decode&& decode) {
+    constexpr int rounds = 10;
+    size_t records = 0;
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        V v;
+        records += decode(stream, v);
+        do_not_optimize(v.index());
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "  " << name << ": "
+              << double(stream.size()) * rounds / seconds / 1e9 << " GB/s, "
+              << double(records) / seconds / 1e6 << " Mrecords/s\n";
+}
+
+template<typename V>
+static size_t decode_all(const std::string& stream, V& v) {
+    size_t records = 0;
+    size_t pos = 0;
+    while (size_t n = decode_variant(stream.data() + pos, stream.size() - pos, v)) {
+        pos += n;
+        ++records;
+    }
+    return records;
+}
+
+template<typename V, typename Decoder>
+static size_t decode_chunked(const std::string& stream, V& v) {
+    constexpr size_t chunk = 64 * 1024;
+    Decoder decoder;
+    size_t records = 0;
+    for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+        decoder.feed(stream.data() + pos, std::min(chunk, stream.size() - pos));
+        while (decoder.next(v)) {
+            ++records;
+        }
+    }
+    return records;
+}
+
+void Run() {
+    using Owning = Variant<int64_t, std::string, double>;
+    using Borrowed = Variant<int64_t, std::string_view, double>;
+
+    std::string stream = make_stream<Owning>(3000000);
+    std::cout << "Variant decode throughput (" << stream.size() / (1 << 20) << " MiB stream):\n";
+    measure<Owning>("owning, whole buffer      ", stream, decode_all<Owning>);
+    measure<Borrowed>("borrowed, whole buffer    ", stream, decode_all<Borrowed>);
+    measure<Owning>("owning, 64 KiB chunks     ", stream,
+                    decode_chunked<Owning, VariantDecoder<int64_t, std::string, double>>);
+    measure<Borrowed>("borrowed, 64 KiB chunks   ", stream,
+                      decode_chunked<Borrowed, VariantDecoder<int64_t, std::string_view, double>>);
+}
+
+}  // namespace codec_bench
+
+namespace packed_bench {
+
+template<typename Array>
+static void measure(const char* name, const Array& values) {
+    constexpr int rounds = 10;
+    double sum = 0;
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (const auto& v : values) {
+            switch (v.index()) {
+                case 0: sum += get<0>(v); break;
+                case 1: sum += get<1>(v); break;
+                default: sum += get<2>(v); break;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    do_not_optimize(sum);
+    double bytes = double(sizeof(values[0])) * values.size() * rounds;
+    std::cout << "  " << name << " (" << sizeof(values[0]) << " bytes/element): "
+              << bytes / seconds / 1e9 << " GB/s, "
+              << double(values.size()) * rounds / seconds / 1e6 << " Melements/s\n";
+}
+
+void Run() {
+    constexpr size_t n = 20000000;
+    std::vector<Variant<uint8_t, uint32_t, double>> padded(n);
+    std::vector<PackedVariant<uint8_t, uint32_t, double>> packed(n);
+    for (size_t k = 0; k < n; ++k) {
+        switch (k % 3) {
+            case 0: padded[k] = static_cast<uint32_t>(k); break;
+            case 1: padded[k] = static_cast<double>(k); break;
+            default: padded[k].emplace<uint8_t>(static_cast<uint8_t>(k)); break;
+        }
+        packed[k] = PackedVariant<uint8_t, uint32_t, double>(padded[k]);
+    }
+    std::cout << "Scan of " << n << " elements:\n";
+    measure("Variant      ", padded);
+    measure("PackedVariant", packed);
+}
+
+}  // namespace packed_bench
+
+namespace interner_bench {
+
+using V = Variant<int64_t, std::string, double>;
+using Interner = VariantInterner<int64_t, std::string, double>;
+
+// Symbol-table-like data: a Zipf-distributed draw from 200k distinct
+// values, a third of them identifiers longer than the SSO buffer.
+static std::vector<V> make_dataset(size_t n) {
+    constexpr size_t distinct = 200000;
+    std::vector<double> cdf(distinct);
+    double acc = 0;
+    for (size_t k = 0; k < distinct; ++k) {
+        acc += 1.0 / double(k + 1);
+        cdf[k] = acc;
+    }
+    uint64_t state = 88172645463325252ull;
+    std::vector<V> values;
+    values.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double u = double(state >> 11) / double(1ull << 53) * acc;
+        size_t key = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        switch (key % 3) {
+            case 0: values.emplace_back(static_cast<int64_t>(key)); break;
+            case 1: values.emplace_back(static_cast<double>(key) / 3); break;
+            default: values.emplace_back("namespace::symbol_" + std::to_string(key)); break;
+        }
+    }
+    return values;
+}
+
+// Heap bytes owned by a value, not counting the value itself.
+static size_t owned_bytes(const std::string& s) {
+    const char* object = reinterpret_cast<const char*>(&s);
+    bool on_heap = s.data() < object || s.data() >= object + sizeof(s);
+    return on_heap ? s.capacity() + 1 : 0;
+}
+
+template<typename T>
+static size_t owned_bytes(const T&) {
+    return 0;
+}
+
+void Run() {
+    constexpr size_t n = 4000000;
+    auto values = make_dataset(n);
+
+    size_t plain_bytes = values.size() * sizeof(V);
+    for (const auto& v : values) {
+        plain_bytes += visit([](const auto& x) { return owned_bytes(x); }, v);
+    }
+    std::cout << "VariantInterner on " << n << " values:\n";
+    std::cout << "  std::vector<Variant>: " << plain_bytes / (1 << 20) << " MiB\n";
+
+    for (unsigned threads_count : {1u, 4u}) {
+        Interner interner;
+        std::vector<Interner::Handle> handles(n);
+
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < threads_count; ++t) {
+            threads.emplace_back([&, t] {
+                for (size_t k = t; k < n; k += threads_count) {
+                    handles[k] = interner.intern(values[k]);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double insert_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        start = Clock::now();
+        size_t checksum = 0;
+        for (auto h : handles) {
+            checksum += interner.visit_handle([](const auto& x) { return owned_bytes(x); }, h);
+        }
+        double lookup_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        do_not_optimize(checksum);
+
+        std::vector<Interner::Handle> distinct = handles;
+        std::sort(distinct.begin(), distinct.end(), [](auto a, auto b) { return a.raw() < b.raw(); });
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+        size_t interned_bytes = handles.size() * sizeof(Interner::Handle) + interner.memory_usage();
+        for (auto h : distinct) {
+            interned_bytes += interner.visit_handle([](const auto& x) { return owned_bytes(x); }, h);
+        }
+
+        std::cout << "  handles + interner, " << threads_count << " thread(s): "
+                  << interned_bytes / (1 << 20) << " MiB, "
+                  << interner.size() << " distinct, "
+                  << n / insert_seconds / 1e6 << " Minserts/s, "
+                  << n / lookup_seconds / 1e6 << " Mlookups/s\n";
+    }
+}
+
+}  // namespace interner_bench
+
+namespace bulk_bench {
+
+using V = Variant<int64_t, double, std::string>;
+
+template<typename F>
+static void measure(const char* name, size_t n, F&& f) {
+    constexpr int rounds = 5;
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        f();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "  " << name << ": " << double(n) * rounds / seconds / 1e6 << " Melements/s\n";
+}
+
+void Run() {
+    constexpr size_t n = 5000000;
+    std::vector<double> src(n);
+    for (size_t k = 0; k < n; ++k) {
+        src[k] = double(k) * 0.25;
+    }
+
+    std::allocator<V> alloc;
+    V* raw = alloc.allocate(n);
+    auto destroy_all = [raw] {
+        for (size_t k = 0; k < n; ++k) {
+            raw[k].~V();
+        }
+    };
+
+    std::cout << "Loading " << n << " doubles into Variant<int64_t, double, std::string>:\n";
+    measure("construct, per element    ", n, [&] {
+        for (size_t k = 0; k < n; ++k) {
+            new (raw + k) V(double(src[k]));
+        }
+        do_not_optimize(raw[n - 1].index());
+        destroy_all();
+    });
+    measure("uninitialized_construct_n ", n, [&] {
+        uninitialized_construct_n(raw, src.data(), n);
+        do_not_optimize(raw[n - 1].index());
+        destroy_all();
+    });
+
+    uninitialized_construct_n(raw, src.data(), n);
+    measure("assign, per element       ", n, [&] {
+        for (size_t k = 0; k < n; ++k) {
+            raw[k] = double(src[k]);
+        }
+        do_not_optimize(raw[n - 1].index());
+    });
+    measure("assign_n                  ", n, [&] {
+        assign_n(raw, src.data(), n);
+        do_not_optimize(raw[n - 1].index());
+    });
+    measure("fill_alternative          ", n, [&] {
+        fill_alternative(raw, n, 1.0);
+        do_not_optimize(raw[n - 1].index());
+    });
+    destroy_all();
+    alloc.deallocate(raw, n);
+}
+
+}  // namespace bulk_bench
+
+int main() {
+    mailbox_bench::Run();
+    dispatch_bench::Run();
+    codec_bench::Run();
+    packed_bench::Run();
+    interner_bench::Run();
+    bulk_bench::Run();
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "variant.h"
+
+// Binary records for Variant values:
+//
+//     varint tag | varint payload size | payload
+//
+// Varints are unsigned LEB128. The tag is the alternative index and the
+// payload is written by FieldCodec of that alternative. Because the payload
+// size comes first, a decoder knows whether a whole record is buffered
+// before it touches the target Variant.
+
+class bad_variant_encoding : public std::exception {
+public:
+    const char* what() const noexcept override {
+        return "bad variant encoding";
+    }
+};
+
+// FieldCodec<T> is the extension point for alternative types:
+//
+//     static void encode(const T& value, std::string& out);
+//     template<typename Emplace>
+//     static void decode(const char* data, size_t size, Emplace&& emplace);
+//
+// decode gets exactly the payload bytes and must call emplace once with the
+// constructor arguments of T, which builds the value in the Variant itself.
+// A codec whose payload always has the same length can also declare
+//
+//     static constexpr size_t fixed_size;
+//
+// so that a record declaring any other size is rejected from its header,
+// before the decoder waits for the payload to arrive.
+template<typename T, typename = void>
+struct FieldCodec;
+
+template<typename T, typename = void>
+struct field_fixed_size {
+    static constexpr size_t value = 0;
+};
+
+template<typename T>
+struct field_fixed_size<T, std::void_t<decltype(FieldCodec<T>::fixed_size)>> {
+    static constexpr size_t value = FieldCodec<T>::fixed_size;
+};
+
+// Copies the bytes of a value between host and little-endian order.
+inline void to_little_endian(char* bytes, size_t size) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    std::reverse(bytes, bytes + size);
+#else
+    (void)bytes;
+    (void)size;
+#endif
+}
+
+// Arithmetic and enum types are stored as their little-endian bytes.
+// bool has its own codec, since only 0 and 1 are valid bools.
+template<typename T>
+struct FieldCodec<T, std::enable_if_t<(std::is_arithmetic_v<T> || std::is_enum_v<T>) && !std::is_same_v<T, bool>>> {
+    static constexpr size_t fixed_size = sizeof(T);
+
+    static void encode(const T& value, std::string& out) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        to_little_endian(bytes, sizeof(T));
+        out.append(bytes, sizeof(T));
+    }
+
+    template<typename Emplace>
+    static void decode(const char* data, size_t size, Emplace&& emplace) {
+        if (size != sizeof(T)) {
+            throw bad_variant_encoding();
+        }
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, data, sizeof(T));
+        to_little_endian(bytes, sizeof(T));
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        emplace(value);
+    }
+};
+
+template<>
+struct FieldCodec<bool> {
+    static constexpr size_t fixed_size = 1;
+
+    static void encode(bool value, std::string& out) {
+        out.push_back(value ? '\x01' : '\x00');
+    }
+
+    template<typename Emplace>
+    static void decode(const char* data, size_t size, Emplace&& emplace) {
+        if (size != 1 || static_cast<unsigned char>(data[0]) > 1) {
+            throw bad_variant_encoding();
+        }
+        emplace(data[0] == 1);
+    }
+};
+
+template<>
+struct FieldCodec<std::string> {
+    static void encode(const std::string& value, std::string& out) {
+        out.append(value);
+    }
+
+    template<typename Emplace>
+    static void decode(const char* data, size_t size, Emplace&& emplace) {
+        emplace(data, size);
+    }
+};
+
+// Borrowed mode: the decoded view points into the input bytes instead of
+// owning a copy, so it is only valid while those bytes are.
+template<>
+struct FieldCodec<std::string_view> {
+    static void encode(std::string_view value, std::string& out) {
+        out.append(value.data(), value.size());
+    }
+
+    template<typename Emplace>
+    static void decode(const char* data, size_t size, Emplace&& emplace) {
+        emplace(data, size);
+    }
+};
+
+inline void encode_varint(uint64_t value, std::string& out) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Returns the number of bytes read, or 0 if the varint is not complete yet.
+// Throws bad_variant_encoding if the value does not fit in 64 bits.
+inline size_t decode_varint(const char* data, size_t size, uint64_t& value) {
+    value = 0;
+    for (size_t k = 0; k < size; ++k) {
+        uint64_t byte = static_cast<unsigned char>(data[k]);
+        // The tenth byte only has room for bit 63, and there is no eleventh.
+        if (k == 9 && byte > 1) {
+            throw bad_variant_encoding();
+        }
+        value |= (byte & 0x7f) << (7 * k);
+        if ((byte & 0x80) == 0) {
+            return k + 1;
+        }
+    }
+    return 0;
+}
+
+template<typename... Types>
+void encode_variant(const Variant<Types...>& v, std::string& out) {
+    if (v.index() >= sizeof...(Types)) {
+        throw std::bad_variant_access();
+    }
+    encode_varint(v.index(), out);
+    size_t payload_start = out.size();
+    visit([&out](const auto& value) {
+        FieldCodec<std::remove_cv_t<std::remove_reference_t<decltype(value)>>>::encode(value, out);
+    }, v);
+
+    std::string size_prefix;
+    encode_varint(out.size() - payload_start, size_prefix);
+    out.insert(payload_start, size_prefix);
+}
+
+template<size_t N, typename... Types>
+void decode_alternative(Variant<Types...>& v, const char* data, size_t size) {
+    FieldCodec<alternative_t<N, Types...>>::decode(data, size, [&v](auto&&... args) {
+        v.template emplace<N>(std::forward<decltype(args)>(args)...);
+    });
+}
+
+template<typename... Types, size_t... Is>
+void decode_payload(Variant<Types...>& v, size_t tag, const char* data, size_t size,
+                    std::index_sequence<Is...>) {
+    using Fn = void(*)(Variant<Types...>&, const char*, size_t);
+    static constexpr Fn table[] = {&decode_alternative<Is, Types...>...};
+    table[tag](v, data, size);
+}
+
+// Decodes one record from the front of [data, data + size) straight into v.
+// Returns the number of bytes consumed, or 0 (leaving v untouched) if the
+// record is not complete yet. Throws bad_variant_encoding on malformed input,
+// including a header that declares a record longer than max_record_size or
+// a payload size a fixed-size alternative cannot have.
+template<typename... Types>
+size_t decode_variant(const char* data, size_t size, Variant<Types...>& v,
+                      size_t max_record_size = SIZE_MAX) {
+    uint64_t tag;
+    size_t tag_bytes = decode_varint(data, size, tag);
+    if (tag_bytes == 0) {
+        return 0;
+    }
+    if (tag >= sizeof...(Types)) {
+        throw bad_variant_encoding();
+    }
+    uint64_t payload_size;
+    size_t size_bytes = decode_varint(data + tag_bytes, size - tag_bytes, payload_size);
+    if (size_bytes == 0) {
+        return 0;
+    }
+    size_t header = tag_bytes + size_bytes;
+    if (payload_size > max_record_size - std::min(header, max_record_size)) {
+        throw bad_variant_encoding();
+    }
+    static constexpr size_t fixed_sizes[] = {field_fixed_size<std::remove_cv_t<Types>>::value...};
+    if (fixed_sizes[tag] != 0 && payload_size != fixed_sizes[tag]) {
+        throw bad_variant_encoding();
+    }
+    if (payload_size > size - header) {
+        return 0;
+    }
+    decode_payload(v, tag, data + header, payload_size, std::index_sequence_for<Types...>());
+    return header + payload_size;
+}
+
+// Incremental decoder for input arriving in arbitrary pieces, e.g. from
+// read() on a pipe. Complete records are decoded in place from the internal
+// buffer; only the unfinished tail is kept between feeds. Borrowed
+// alternatives point into that buffer and stay valid until the next feed().
+// A record whose header declares more than max_record_size bytes is
+// rejected instead of being buffered until it arrives.
+template<typename... Types>
+class VariantDecoder {
+private:
+    std::string buffer;
+    size_t offset = 0;
+    size_t max_record_size;
+
+public:
+    static constexpr size_t default_max_record_size = size_t(16) << 20;
+
+    explicit VariantDecoder(size_t max_record_size = default_max_record_size)
+        : max_record_size(max_record_size)
+    {}
+
+    void feed(const char* data, size_t size) {
+        if (offset != 0) {
+            buffer.erase(0, offset);
+            offset = 0;
+        }
+        buffer.append(data, size);
+    }
+
+    void feed(std::string_view data) {
+        feed(data.data(), data.size());
+    }
+
+    // Decodes the next complete record into v, returns false if there is none.
+    bool next(Variant<Types...>& v) {
+        size_t consumed = decode_variant(buffer.data() + offset, buffer.size() - offset, v, max_record_size);
+        offset += consumed;
+        return consumed != 0;
+    }
+
+    size_t buffered() const {
+        return buffer.size() - offset;
+    }
+};
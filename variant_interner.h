@@ -0,0 +1,314 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "variant.h"
+
+// Distinct values of one alternative type that hash to the same shard.
+// Values live in segments of geometrically growing size which never move,
+// so a value can be read by its local index without taking the lock;
+// the lock only guards insertion and the open addressing table of local
+// indices used to find an existing equal value.
+template<typename T>
+class InternShard {
+private:
+    static constexpr unsigned first_segment_bits = 6;
+    static constexpr size_t max_segments = 32 - first_segment_bits;
+
+    std::mutex mutex;
+    std::atomic<T*> segments[max_segments] = {};
+    uint32_t count = 0;
+    std::vector<uint32_t> slots;
+
+    static unsigned floor_log2(uint32_t x) {
+        unsigned result = 0;
+        while (x >>= 1) {
+            ++result;
+        }
+        return result;
+    }
+
+    static size_t segment_size(unsigned segment) {
+        return size_t(1) << (first_segment_bits + segment);
+    }
+
+    static size_t segment_start(unsigned segment) {
+        return (size_t(1) << first_segment_bits) * ((size_t(1) << segment) - 1);
+    }
+
+    static unsigned segment_of(uint32_t local) {
+        return floor_log2((local >> first_segment_bits) + 1);
+    }
+
+    void rehash() {
+        std::vector<uint32_t> grown(slots.empty() ? 16 : slots.size() * 2, 0);
+        size_t mask = grown.size() - 1;
+        for (uint32_t slot : slots) {
+            if (slot != 0) {
+                size_t pos = mix(std::hash<T>()(value(slot - 1))) & mask;
+                while (grown[pos] != 0) {
+                    pos = (pos + 1) & mask;
+                }
+                grown[pos] = slot;
+            }
+        }
+        slots.swap(grown);
+    }
+
+public:
+    static uint64_t mix(uint64_t h) {
+        // std::hash is the identity for integers, so spread the bits before
+        // using them to pick a shard and a slot.
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    InternShard() = default;
+    InternShard(const InternShard&) = delete;
+    InternShard& operator=(const InternShard&) = delete;
+
+    ~InternShard() {
+        for (unsigned segment = 0; segment < max_segments; ++segment) {
+            T* data = segments[segment].load(std::memory_order_relaxed);
+            if (data == nullptr) {
+                break;
+            }
+            size_t start = segment_start(segment);
+            size_t used = count > start ? std::min(segment_size(segment), count - start) : 0;
+            for (size_t k = 0; k < used; ++k) {
+                data[k].~T();
+            }
+            std::allocator<T>().deallocate(data, segment_size(segment));
+        }
+    }
+
+    // Returns the local index of the stored value equal to the argument,
+    // storing a copy first if there is none.
+    uint32_t intern(const T& x, uint64_t hash, uint32_t max_count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slots.empty()) {
+            rehash();
+        }
+        size_t mask = slots.size() - 1;
+        size_t pos = hash & mask;
+        while (slots[pos] != 0) {
+            if (value(slots[pos] - 1) == x) {
+                return slots[pos] - 1;
+            }
+            pos = (pos + 1) & mask;
+        }
+
+        uint32_t local = count;
+        if (local >= max_count) {
+            throw std::length_error("VariantInterner shard is full");
+        }
+        unsigned segment = segment_of(local);
+        T* data = segments[segment].load(std::memory_order_relaxed);
+        if (data == nullptr) {
+            data = std::allocator<T>().allocate(segment_size(segment));
+            segments[segment].store(data, std::memory_order_release);
+        }
+        new (data + (local - segment_start(segment))) T(x);
+        ++count;
+        slots[pos] = local + 1;
+        if (size_t(count) * 2 > slots.size()) {
+            rehash();
+        }
+        return local;
+    }
+
+    const T& value(uint32_t local) const {
+        unsigned segment = segment_of(local);
+        return segments[segment].load(std::memory_order_acquire)[local - segment_start(segment)];
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+    // Bytes held by the shard itself, not counting memory owned by the values.
+    size_t memory_usage() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t result = sizeof(*this) + slots.capacity() * sizeof(uint32_t);
+        for (unsigned segment = 0; segment < max_segments; ++segment) {
+            if (segments[segment].load(std::memory_order_relaxed) != nullptr) {
+                result += segment_size(segment) * sizeof(T);
+            }
+        }
+        return result;
+    }
+};
+
+// Hash-consing pool for Variant values. Equal values are stored once and
+// identified by a 32-bit Handle, so two handles compare equal exactly when
+// the values do. The top bits of a handle hold the alternative index, the
+// rest select a shard and a position in it. Insertion takes the lock of
+// one shard only; reading a value through a handle takes no lock at all.
+template<typename... Types>
+class VariantInterner {
+private:
+    static constexpr size_t alternatives = sizeof...(Types);
+
+    static constexpr unsigned bits_for(size_t n) {
+        unsigned result = 1;
+        while ((size_t(1) << result) < n) {
+            ++result;
+        }
+        return result;
+    }
+
+    static constexpr unsigned tag_bits = bits_for(alternatives);
+    static constexpr unsigned shard_bits = 4;
+    static constexpr size_t shards = size_t(1) << shard_bits;
+    static constexpr unsigned local_bits = 32 - tag_bits - shard_bits;
+
+    static_assert(local_bits >= 16, "Too many alternatives for 32-bit handles");
+
+    std::tuple<std::array<InternShard<std::remove_cv_t<Types>>, shards>...> stores;
+
+public:
+    class Handle {
+    private:
+        uint32_t bits;
+
+    public:
+        // All bits set is never handed out by intern(), so a default
+        // constructed handle refers to no value.
+        static constexpr uint32_t invalid = UINT32_MAX;
+
+        constexpr Handle() : bits(invalid) {}
+        constexpr explicit Handle(uint32_t bits) : bits(bits) {}
+
+        constexpr bool valid() const {
+            return bits != invalid;
+        }
+
+        constexpr size_t index() const {
+            return bits >> (32 - tag_bits);
+        }
+
+        constexpr uint32_t raw() const {
+            return bits;
+        }
+
+        constexpr bool operator==(Handle other) const {
+            return bits == other.bits;
+        }
+
+        constexpr bool operator!=(Handle other) const {
+            return bits != other.bits;
+        }
+    };
+
+    VariantInterner() = default;
+    VariantInterner(const VariantInterner&) = delete;
+    VariantInterner& operator=(const VariantInterner&) = delete;
+
+    template<size_t N>
+    Handle intern(const alternative_t<N, Types...>& x) {
+        using T = alternative_t<N, Types...>;
+        uint64_t hash = InternShard<T>::mix(std::hash<T>()(x));
+        uint32_t shard = static_cast<uint32_t>(hash >> (64 - shard_bits));
+        // The last local index of each shard is left unused, which keeps
+        // Handle::invalid out of reach even when every tag value is taken.
+        uint32_t local = std::get<N>(stores)[shard].intern(x, hash, (uint32_t(1) << local_bits) - 1);
+        return Handle((uint32_t(N) << (32 - tag_bits)) | (local << shard_bits) | shard);
+    }
+
+    template<typename T, typename = std::enable_if_t<(index_by_type<std::remove_cv_t<T>, Types...> < alternatives)>>
+    Handle intern(const T& x) {
+        return intern<index_by_type<std::remove_cv_t<T>, Types...>>(x);
+    }
+
+    Handle intern(const Variant<Types...>& v) {
+        return visit([this](const auto& x) {
+            return intern<index_by_type<std::remove_cv_t<std::remove_reference_t<decltype(x)>>, Types...>>(x);
+        }, v);
+    }
+
+    // The reference stays valid for the lifetime of the interner.
+    template<size_t N>
+    const alternative_t<N, Types...>& get(Handle h) const {
+        if (!h.valid() || h.index() != N) {
+            throw std::bad_variant_access();
+        }
+        uint32_t id = h.raw() & ((uint32_t(1) << (32 - tag_bits)) - 1);
+        return std::get<N>(stores)[id & (shards - 1)].value(id >> shard_bits);
+    }
+
+    template<typename T>
+    const T& get(Handle h) const {
+        return get<index_by_type<T, Types...>>(h);
+    }
+
+    Variant<Types...> to_variant(Handle h) const {
+        return to_variant_impl(h, std::index_sequence_for<Types...>());
+    }
+
+    template<typename Visitor>
+    decltype(auto) visit_handle(Visitor&& vis, Handle h) const {
+        return visit_handle_impl(std::forward<Visitor>(vis), h, std::index_sequence_for<Types...>());
+    }
+
+    // Number of distinct values stored.
+    size_t size() {
+        return sum_over_shards([](auto& shard) { return shard.size(); });
+    }
+
+    // Bytes held by the interner, not counting memory owned by the values,
+    // such as the heap buffers of long strings.
+    size_t memory_usage() {
+        return sum_over_shards([](auto& shard) { return shard.memory_usage(); });
+    }
+
+private:
+    template<typename F>
+    size_t sum_over_shards(F&& f) {
+        return std::apply([&f](auto&... arrays) {
+            size_t total = 0;
+            auto add = [&f, &total](auto& shard_array) {
+                for (auto& shard : shard_array) {
+                    total += f(shard);
+                }
+            };
+            (add(arrays), ...);
+            return total;
+        }, stores);
+    }
+
+    template<size_t... Is>
+    Variant<Types...> to_variant_impl(Handle h, std::index_sequence<Is...>) const {
+        if (!h.valid() || h.index() >= alternatives) {
+            throw std::bad_variant_access();
+        }
+        Variant<Types...> result;
+        ((h.index() == Is ? (result.template emplace<Is>(get<Is>(h)), true) : false) || ...);
+        return result;
+    }
+
+    template<typename Visitor, size_t... Is>
+    decltype(auto) visit_handle_impl(Visitor&& vis, Handle h, std::index_sequence<Is...>) const {
+        using R = decltype(std::forward<Visitor>(vis)(get<0>(h)));
+        using Fn = R(*)(const VariantInterner&, Visitor&&, Handle);
+        static constexpr Fn table[] = {
+            [](const VariantInterner& self, Visitor&& f, Handle handle) -> R {
+                return std::forward<Visitor>(f)(self.template get<Is>(handle));
+            }...
+        };
+        if (!h.valid() || h.index() >= alternatives) {
+            throw std::bad_variant_access();
+        }
+        return table[h.index()](*this, std::forward<Visitor>(vis), h);
+    }
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#include "variant.h"
+
+// Bounded multi-producer/single-consumer ring of Variant slots.
+// Each slot carries a sequence number (Vyukov's bounded queue): producers
+// claim a position with a CAS on enqueue_pos and construct the message
+// straight into the slot with emplace, the single consumer drains published
+// slots in order and hands every message to a visitor.
+template<typename... Types>
+class VariantMailbox {
+private:
+    static constexpr size_t cache_line = 64;
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        Variant<Types...> value;
+    };
+
+    std::unique_ptr<Cell[]> buffer;
+    size_t mask;
+
+    alignas(cache_line) std::atomic<size_t> enqueue_pos;
+    alignas(cache_line) size_t dequeue_pos;
+
+    // Destroys the consumed payload and hands the slot back to producers,
+    // so that heap memory of a message is not held for a whole ring cycle.
+    void release(Cell& cell, size_t pos) {
+        cell.value.destruct();
+        cell.value.i = sizeof...(Types);
+        cell.value.valueless = true;
+        cell.seq.store(pos + mask + 1, std::memory_order_release);
+    }
+
+    static size_t round_up_capacity(size_t capacity) {
+        size_t result = 2;
+        while (result < capacity) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    template<size_t N, typename... Args>
+    bool try_emplace_impl(Args&&... args) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &buffer[pos & mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        try {
+            cell->value.template emplace<N>(std::forward<Args>(args)...);
+        } catch(...) {
+            // The slot is already claimed, so it has to be published anyway;
+            // the consumer skips it because it is valueless.
+            cell->seq.store(pos + 1, std::memory_order_release);
+            throw;
+        }
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+public:
+    explicit VariantMailbox(size_t capacity)
+        : buffer(new Cell[round_up_capacity(capacity)])
+        , mask(round_up_capacity(capacity) - 1)
+        , enqueue_pos(0)
+        , dequeue_pos(0)
+    {
+        for (size_t k = 0; k <= mask; ++k) {
+            buffer[k].seq.store(k, std::memory_order_relaxed);
+        }
+    }
+
+    VariantMailbox(const VariantMailbox&) = delete;
+    VariantMailbox& operator=(const VariantMailbox&) = delete;
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    // Producer side, safe to call from any number of threads.
+    // Returns false when the mailbox is full.
+    template<typename T, typename... Args>
+    bool try_emplace(Args&&... args) {
+        return try_emplace_impl<index_by_type<T, Types...>>(std::forward<Args>(args)...);
+    }
+
+    template<size_t N, typename... Args>
+    bool try_emplace(Args&&... args) {
+        return try_emplace_impl<N>(std::forward<Args>(args)...);
+    }
+
+    // Consumer side, must be called from a single thread at a time.
+    // Invokes handler on the alternative held by each of up to max_batch
+    // published messages and returns how many slots were consumed.
+    template<typename Handler>
+    size_t drain(Handler&& handler, size_t max_batch = SIZE_MAX) {
+        size_t pos = dequeue_pos;
+        size_t consumed = 0;
+        while (consumed < max_batch) {
+            Cell& cell = buffer[pos & mask];
+            if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+                break;
+            }
+            try {
+                if (!cell.value.valueless_by_exception()) {
+                    visit(handler, cell.value);
+                }
+            } catch(...) {
+                release(cell, pos);
+                dequeue_pos = pos + 1;
+                throw;
+            }
+            release(cell, pos);
+            ++pos;
+            ++consumed;
+        }
+        dequeue_pos = pos;
+        return consumed;
+    }
+
+    // Approximate when producers are running concurrently.
+    bool empty() const {
+        return buffer[dequeue_pos & mask].seq.load(std::memory_order_acquire) != dequeue_pos + 1;
+    }
+};
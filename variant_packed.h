@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "variant.h"
+
+// Variant without padding: a one byte tag followed by the payload bytes,
+// alignment 1. It can be stored densely in arrays and placed in
+// #pragma pack wire structs. Since the payload may sit at any address,
+// alternatives are read and written by value through memcpy, which
+// compiles to plain unaligned loads and stores. The alternatives have to
+// be trivially copyable for that, and there can be at most 255 of them.
+template<typename... Types>
+class PackedVariant {
+private:
+    static_assert(sizeof...(Types) > 0 && sizeof...(Types) < 256,
+                  "PackedVariant supports from 1 to 255 alternatives");
+    static_assert((std::is_trivially_copyable_v<Types> && ...),
+                  "PackedVariant alternatives must be trivially copyable");
+
+    template<typename T>
+    static constexpr bool is_alternative = index_by_type<std::remove_cv_t<T>, Types...> < sizeof...(Types);
+
+    unsigned char tag;
+    unsigned char payload[std::max({sizeof(Types)...})];
+
+    template<size_t... Is>
+    Variant<Types...> to_variant_impl(std::index_sequence<Is...>) const {
+        if (index() >= sizeof...(Types)) {
+            throw std::bad_variant_access();
+        }
+        Variant<Types...> result;
+        ((tag == Is ? (result.template emplace<Is>(load<Is>()), true) : false) || ...);
+        return result;
+    }
+
+public:
+    PackedVariant()
+        : payload{}
+    {
+        store<0>(alternative_t<0, Types...>());
+    }
+
+    template<typename T, typename = std::enable_if_t<is_alternative<T>>>
+    PackedVariant(const T& value)
+        : payload{}
+    {
+        store<index_by_type<std::remove_cv_t<T>, Types...>>(value);
+    }
+
+    explicit PackedVariant(const Variant<Types...>& v)
+        : payload{}
+    {
+        visit([this](const auto& value) {
+            using T = std::remove_cv_t<std::remove_reference_t<decltype(value)>>;
+            store<index_by_type<T, Types...>>(value);
+        }, v);
+    }
+
+    template<typename T, typename = std::enable_if_t<is_alternative<T>>>
+    PackedVariant& operator=(const T& value) {
+        store<index_by_type<std::remove_cv_t<T>, Types...>>(value);
+        return *this;
+    }
+
+    template<size_t N>
+    void store(const alternative_t<N, Types...>& value) {
+        std::memcpy(payload, &value, sizeof(value));
+        tag = static_cast<unsigned char>(N);
+    }
+
+    // Reads the payload as alternative N without checking the tag.
+    template<size_t N>
+    alternative_t<N, Types...> load() const {
+        alternative_t<N, Types...> value;
+        std::memcpy(&value, payload, sizeof(value));
+        return value;
+    }
+
+    template<typename T, typename... Args>
+    T emplace(Args&&... args) {
+        return emplace<index_by_type<T, Types...>>(std::forward<Args>(args)...);
+    }
+
+    template<size_t N, typename... Args>
+    alternative_t<N, Types...> emplace(Args&&... args) {
+        alternative_t<N, Types...> value(std::forward<Args>(args)...);
+        store<N>(value);
+        return value;
+    }
+
+    constexpr size_t index() const {
+        return tag;
+    }
+
+    Variant<Types...> to_variant() const {
+        return to_variant_impl(std::index_sequence_for<Types...>());
+    }
+};
+
+template<typename T, typename... Types>
+bool holds_alternative(const PackedVariant<Types...>& v) {
+    return index_by_type<T, Types...> == v.index();
+}
+
+template<size_t N, typename... Types>
+alternative_t<N, Types...> get(const PackedVariant<Types...>& v) {
+    if (v.index() == N) {
+        return v.template load<N>();
+    }
+    throw std::bad_variant_access();
+}
+
+template<typename T, typename... Types>
+T get(const PackedVariant<Types...>& v) {
+    return get<index_by_type<T, Types...>>(v);
+}
+
+template<typename Visitor, typename... Types, size_t... Is>
+decltype(auto) visit_packed_impl(Visitor&& vis, const PackedVariant<Types...>& v, std::index_sequence<Is...>) {
+    using R = decltype(std::forward<Visitor>(vis)(v.template load<0>()));
+    using Fn = R(*)(Visitor&&, const PackedVariant<Types...>&);
+    static constexpr Fn table[] = {
+        [](Visitor&& f, const PackedVariant<Types...>& var) -> R {
+            return std::forward<Visitor>(f)(var.template load<Is>());
+        }...
+    };
+    if (v.index() >= sizeof...(Types)) {
+        throw std::bad_variant_access();
+    }
+    return table[v.index()](std::forward<Visitor>(vis), v);
+}
+
+// The visitor gets a copy of the held alternative, not a reference.
+template<typename Visitor, typename... Types>
+decltype(auto) visit(Visitor&& vis, const PackedVariant<Types...>& v) {
+    return visit_packed_impl(std::forward<Visitor>(vis), v, std::index_sequence_for<Types...>());
+}
@@ -3,8 +3,16 @@
 #include <vector>
 #include <type_traits>
 #include <cassert>
+#include <thread>
+#include <random>
+#include <memory>
+#include <cstring>
 
 #include "variant.h"
+#include "variant_mailbox.h"
+#include "variant_codec.h"
+#include "variant_packed.h"
+#include "variant_interner.h"
 
 //template <typename... Args>
 //using Variant = std::variant<Args...>;
@@ -213,6 +221,651 @@ void TestVariantWithConstType() {
 
 struct VerySpecialType {};
 
+struct Tick { long seq; };
+struct Order { int producer; long seq; };
+struct Cancel { std::string reason; };
+
+void TestMailbox() {
+
+    VariantMailbox<Tick, Order, Cancel> box(3);
+    assert(box.capacity() == 4);
+    assert(box.empty());
+
+    assert(box.try_emplace<Tick>(Tick{1}));
+    assert(box.try_emplace<Cancel>(Cancel{"abc"}));
+    assert(box.try_emplace<1>(Order{7, 2}));
+    assert(box.try_emplace<Tick>(Tick{3}));
+    assert(!box.try_emplace<Tick>(Tick{4}));
+
+    std::vector<size_t> seen;
+    struct {
+        std::vector<size_t>& seen;
+        void operator()(Tick& t) { seen.push_back(t.seq); }
+        void operator()(Order& o) { assert(o.producer == 7); seen.push_back(o.seq); }
+        void operator()(Cancel& c) { assert(c.reason == "abc"); seen.push_back(0); }
+    } handler{seen};
+
+    assert(box.drain(handler, 2) == 2);
+    assert((seen == std::vector<size_t>{1, 0}));
+
+    assert(box.try_emplace<Tick>(Tick{5}));
+    assert(box.drain(handler) == 3);
+    assert((seen == std::vector<size_t>{1, 0, 2, 3, 5}));
+    assert(box.empty());
+    assert(box.drain(handler) == 0);
+
+    // Consumed payloads are released right away, not when the slot is reused.
+    auto payload = std::make_shared<int>(0);
+    VariantMailbox<int, std::shared_ptr<int>> owners(4);
+    assert(owners.try_emplace<std::shared_ptr<int>>(payload));
+    assert(payload.use_count() == 2);
+    assert(owners.drain([](const auto&) {}) == 1);
+    assert(payload.use_count() == 1);
+    assert(owners.try_emplace<int>(1));
+    assert(owners.drain([](const auto&) {}) == 1);
+}
+
+void TestMailboxConcurrent() {
+
+    constexpr int producers = 4;
+    constexpr long per_producer = 100000;
+
+    VariantMailbox<Tick, Order, Cancel> box(256);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&box, p] {
+            for (long k = 0; k < per_producer; ++k) {
+                if (k % 1000 == 999) {
+                    while (!box.try_emplace<Cancel>(Cancel{"cancel"})) {
+                        std::this_thread::yield();
+                    }
+                }
+                else {
+                    while (!box.try_emplace<Order>(Order{p, k})) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+    }
+
+    std::vector<long> next(producers, 0);
+    long cancels = 0;
+    long received = 0;
+    struct {
+        std::vector<long>& next;
+        long& cancels;
+        void operator()(Tick&) { assert(false); }
+        void operator()(Order& o) {
+            // Messages of one producer are observed in the order they were sent.
+            assert(o.seq == next[o.producer]);
+            next[o.producer] = o.seq + (o.seq % 1000 == 998 ? 2 : 1);
+        }
+        void operator()(Cancel& c) { assert(c.reason == "cancel"); ++cancels; }
+    } handler{next, cancels};
+
+    while (received < producers * per_producer) {
+        size_t n = box.drain(handler, 64);
+        if (n == 0) {
+            std::this_thread::yield();
+        }
+        received += n;
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    assert(box.empty());
+    assert(cancels == producers * (per_producer / 1000));
+    for (int p = 0; p < producers; ++p) {
+        assert(next[p] == per_producer);
+    }
+}
+
+
+void TestHintedVisit() {
+
+    struct Visitor {
+        int operator()(int x) const { return x; }
+        int operator()(const std::string& s) const { return static_cast<int>(s.size()); }
+        int operator()(double d) const { return static_cast<int>(d) * 10; }
+    };
+
+    Variant<int, std::string, double> v = 7;
+    assert(visit_hinted<int>(Visitor{}, v) == 7);
+    assert((visit_hinted<double, std::string>(Visitor{}, v) == 7));
+
+    v = "abcd";
+    assert(visit_hinted<int>(Visitor{}, v) == 4);
+    assert(visit_hinted<std::string>(Visitor{}, v) == 4);
+
+    const auto& cv = v;
+    assert(visit_hinted<double>(Visitor{}, cv) == 4);
+
+    v = 2.0;
+    assert(visit(Visitor{}, v) == 20);
+    assert(visit_hinted<double>(Visitor{}, v) == 20);
+}
+
+
+void TestCodecRoundTrip() {
+
+    using V = Variant<int64_t, std::string, double, uint8_t>;
+
+    std::mt19937 gen(42);
+    auto random_value = [&gen]() -> V {
+        switch (gen() % 4) {
+            case 0: return static_cast<int64_t>(gen()) << (gen() % 32);
+            case 1: return std::string(gen() % 300, static_cast<char>('a' + gen() % 26));
+            case 2: return static_cast<double>(gen()) / 7.0;
+            default: {
+                V v;
+                v.emplace<uint8_t>(static_cast<uint8_t>(gen()));
+                return v;
+            }
+        }
+    };
+    auto same = [](const V& a, const V& b) {
+        if (a.index() != b.index()) {
+            return false;
+        }
+        switch (a.index()) {
+            case 0: return get<0>(a) == get<0>(b);
+            case 1: return get<1>(a) == get<1>(b);
+            case 2: return get<2>(a) == get<2>(b);
+            default: return get<3>(a) == get<3>(b);
+        }
+    };
+
+    for (int iteration = 0; iteration < 50; ++iteration) {
+        std::vector<V> values;
+        std::string stream;
+        for (int k = 0; k < 200; ++k) {
+            values.push_back(random_value());
+            encode_variant(values.back(), stream);
+        }
+
+        VariantDecoder<int64_t, std::string, double, uint8_t> decoder;
+        size_t fed = 0;
+        size_t decoded = 0;
+        V v;
+        while (fed < stream.size()) {
+            // Feed chunks of random size, including single bytes, to cut
+            // records at every possible place.
+            size_t chunk = std::min<size_t>(stream.size() - fed, gen() % 64 + 1);
+            decoder.feed(stream.data() + fed, chunk);
+            fed += chunk;
+            while (decoder.next(v)) {
+                assert(same(v, values[decoded]));
+                ++decoded;
+            }
+        }
+        assert(decoded == values.size());
+        assert(decoder.buffered() == 0);
+    }
+
+    // Garbage input either decodes or throws, but never reads past the end.
+    for (int iteration = 0; iteration < 2000; ++iteration) {
+        std::string garbage(gen() % 40, '\0');
+        for (auto& c : garbage) {
+            c = static_cast<char>(gen());
+        }
+        VariantDecoder<int64_t, std::string, double, uint8_t> decoder;
+        decoder.feed(garbage);
+        V v;
+        try {
+            while (decoder.next(v)) {
+            }
+        } catch (const bad_variant_encoding&) {
+            // ok
+        }
+    }
+
+    // Numbers are little-endian on the wire whatever the host order is.
+    Variant<uint32_t, bool> n = static_cast<uint32_t>(0x04030201);
+    std::string bytes;
+    encode_variant(n, bytes);
+    assert(bytes == std::string("\x00\x04\x01\x02\x03\x04", 6));
+
+    n = true;
+    bytes.clear();
+    encode_variant(n, bytes);
+    assert(bytes == std::string("\x01\x01\x01", 3));
+    Variant<uint32_t, bool> decoded_bool;
+    assert(decode_variant(bytes.data(), bytes.size(), decoded_bool) == 3);
+    assert(get<bool>(decoded_bool));
+
+    // Any byte other than 0 or 1 is not a bool.
+    bytes[2] = '\x02';
+    try {
+        decode_variant(bytes.data(), bytes.size(), decoded_bool);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+}
+
+void TestCodecBorrowed() {
+
+    Variant<int, std::string_view> v = 5;
+    std::string stream;
+    encode_variant(v, stream);
+    v = std::string_view("borrowed");
+    encode_variant(v, stream);
+
+    Variant<int, std::string_view> out;
+    size_t first = decode_variant(stream.data(), stream.size(), out);
+    assert(first != 0);
+    assert(get<int>(out) == 5);
+
+    assert(decode_variant(stream.data() + first, stream.size() - first - 1, out) == 0);
+    assert(holds_alternative<int>(out));
+
+    size_t second = decode_variant(stream.data() + first, stream.size() - first, out);
+    assert(first + second == stream.size());
+    assert(get<std::string_view>(out) == "borrowed");
+    assert(get<std::string_view>(out).data() >= stream.data());
+    assert(get<std::string_view>(out).data() < stream.data() + stream.size());
+
+    std::string bad_tag("\x05\x00", 2);
+    try {
+        decode_variant(bad_tag.data(), bad_tag.size(), out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+
+    std::string bad_size("\x00\x02" "ab", 4);
+    try {
+        decode_variant(bad_size.data(), bad_size.size(), out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+    assert(get<std::string_view>(out) == "borrowed");
+}
+
+void TestCodecRejectsOversizedRecords() {
+
+    using V = Variant<int64_t, std::string>;
+
+    // An int64_t record declaring 4 GiB of payload is rejected from its
+    // header alone, without waiting for the payload.
+    std::string huge_int("\x00\x80\x80\x80\x80\x10", 6);
+    V out;
+    try {
+        decode_variant(huge_int.data(), huge_int.size(), out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+
+    // A payload size whose tenth varint byte carries bits past 64.
+    std::string overflow_size("\x00\x88\x80\x80\x80\x80\x80\x80\x80\x80\x7e", 11);
+    overflow_size.append(8, '\x01');
+    try {
+        decode_variant(overflow_size.data(), overflow_size.size(), out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+
+    std::string short_int("\x00\x04", 2);
+    try {
+        decode_variant(short_int.data(), short_int.size(), out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+
+    // A string record declaring 2^49 bytes is over the decoder limit.
+    std::string huge_string("\x01\x80\x80\x80\x80\x80\x80\x80\x01", 9);
+    VariantDecoder<int64_t, std::string> decoder;
+    decoder.feed(huge_string);
+    try {
+        decoder.next(out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+
+    VariantDecoder<int64_t, std::string> small(16);
+    V v = std::string(10, 'a');
+    std::string stream;
+    encode_variant(v, stream);
+    small.feed(stream);
+    assert(small.next(out));
+    assert(get<std::string>(out).size() == 10);
+
+    v = std::string(20, 'a');
+    stream.clear();
+    encode_variant(v, stream);
+    small.feed(stream.data(), 2);
+    try {
+        small.next(out);
+        assert(false);
+    } catch (const bad_variant_encoding&) {
+        // ok
+    }
+}
+
+
+#pragma pack(push, 1)
+struct WireHeader {
+    uint16_t length;
+    PackedVariant<uint8_t, uint32_t, double> value;
+    uint8_t flags;
+};
+#pragma pack(pop)
+
+void TestPackedVariant() {
+
+    using Packed = PackedVariant<uint8_t, uint32_t, double>;
+
+    static_assert(sizeof(Packed) == 9);
+    static_assert(alignof(Packed) == 1);
+    static_assert(sizeof(Packed[4]) == 36);
+    static_assert(sizeof(WireHeader) == 12);
+    static_assert(sizeof(Packed) < sizeof(Variant<uint8_t, uint32_t, double>));
+
+    Packed p;
+    assert(holds_alternative<uint8_t>(p));
+    assert(get<uint8_t>(p) == 0);
+
+    p = 2.5;
+    assert(p.index() == 2);
+    assert(get<double>(p) == 2.5);
+    assert(get<2>(p) == 2.5);
+    try {
+        get<uint32_t>(p);
+        assert(false);
+    } catch (...) {
+        // ok
+    }
+
+    // Every element of the array sits at an odd offset from the previous one.
+    Packed values[5];
+    for (uint32_t k = 0; k < 5; ++k) {
+        if (k % 2 == 0) {
+            values[k] = k * 1000;
+        }
+        else {
+            values[k].emplace<double>(k + 0.25);
+        }
+    }
+    double sum = 0;
+    for (const auto& v : values) {
+        sum += visit([](auto x) { return static_cast<double>(x); }, v);
+    }
+    assert(sum == 0 + 1.25 + 2000 + 3.25 + 4000);
+
+    WireHeader header{};
+    header.length = 7;
+    header.value = static_cast<uint32_t>(0xdeadbeef);
+    header.flags = 3;
+    assert(get<uint32_t>(header.value) == 0xdeadbeef);
+    assert(header.flags == 3);
+
+    Variant<uint8_t, uint32_t, double> v = 1.5;
+    Packed from_variant(v);
+    assert(get<double>(from_variant) == 1.5);
+
+    v = static_cast<uint32_t>(42);
+    Packed other(v);
+    auto back = other.to_variant();
+    assert(holds_alternative<uint32_t>(back));
+    assert(get<uint32_t>(back) == 42);
+
+    // A record off the wire may carry a tag no alternative has.
+    unsigned char record[sizeof(Packed)] = {200, 1, 2, 3, 4, 5, 6, 7, 8};
+    Packed corrupted;
+    std::memcpy(&corrupted, record, sizeof(record));
+    assert(corrupted.index() == 200);
+    try {
+        visit([](auto x) { return static_cast<double>(x); }, corrupted);
+        assert(false);
+    } catch (const std::bad_variant_access&) {
+        // ok
+    }
+    try {
+        corrupted.to_variant();
+        assert(false);
+    } catch (const std::bad_variant_access&) {
+        // ok
+    }
+}
+
+
+void TestInterner() {
+
+    VariantInterner<int64_t, std::string, double> interner;
+    using Handle = VariantInterner<int64_t, std::string, double>::Handle;
+
+    static_assert(sizeof(Handle) == 4);
+
+    Handle a = interner.intern(std::string("symbol"));
+    Handle b = interner.intern(std::string("symbol"));
+    Handle c = interner.intern(std::string("other"));
+    Handle d = interner.intern(static_cast<int64_t>(5));
+    Handle e = interner.intern(5.0);
+
+    assert(a == b);
+    assert(a != c);
+    assert(d != e);
+    assert(a.index() == 1);
+    assert(d.index() == 0);
+    assert(e.index() == 2);
+    assert(&interner.get<std::string>(a) == &interner.get<std::string>(b));
+    assert(interner.get<1>(c) == "other");
+    assert(interner.get<int64_t>(d) == 5);
+    assert(interner.size() == 4);
+
+    try {
+        interner.get<double>(a);
+        assert(false);
+    } catch (...) {
+        // ok
+    }
+
+    Variant<int64_t, std::string, double> v = "symbol";
+    assert(interner.intern(v) == a);
+    auto back = interner.to_variant(c);
+    assert(get<std::string>(back) == "other");
+    assert(interner.visit_handle([](const auto& x) { return sizeof(x); }, e) == sizeof(double));
+
+    // A default handle refers to nothing, even for alternative 0.
+    VariantInterner<int64_t, std::string> empty;
+    VariantInterner<int64_t, std::string>::Handle none;
+    assert(!none.valid());
+    try {
+        empty.get<int64_t>(none);
+        assert(false);
+    } catch (const std::bad_variant_access&) {
+        // ok
+    }
+    try {
+        empty.visit_handle([](const auto&) {}, none);
+        assert(false);
+    } catch (const std::bad_variant_access&) {
+        // ok
+    }
+    try {
+        empty.to_variant(none);
+        assert(false);
+    } catch (const std::bad_variant_access&) {
+        // ok
+    }
+    assert(interner.intern(static_cast<int64_t>(0)).valid());
+
+    std::vector<Handle> handles;
+    for (int64_t k = 0; k < 100000; ++k) {
+        handles.push_back(interner.intern(k % 1000));
+    }
+    for (int64_t k = 0; k < 100000; ++k) {
+        assert(handles[k] == handles[k % 1000]);
+        assert(interner.get<int64_t>(handles[k]) == k % 1000);
+    }
+    assert(interner.size() == 4 + 999);
+}
+
+void TestInternerConcurrent() {
+
+    constexpr int threads_count = 4;
+    constexpr int per_thread = 50000;
+
+    VariantInterner<int64_t, std::string, double> interner;
+    using Handle = VariantInterner<int64_t, std::string, double>::Handle;
+
+    std::vector<std::vector<Handle>> handles(threads_count);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&interner, &handles, t] {
+            for (int k = 0; k < per_thread; ++k) {
+                int key = (k * 7 + t * 13) % 5000;
+                Handle h = key % 2 == 0
+                    ? interner.intern("s" + std::to_string(key))
+                    : interner.intern(static_cast<int64_t>(key));
+                if (key % 2 == 0) {
+                    assert(interner.get<std::string>(h) == "s" + std::to_string(key));
+                }
+                else {
+                    assert(interner.get<int64_t>(h) == key);
+                }
+                handles[t].push_back(h);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    assert(interner.size() == 5000);
+    std::vector<Handle> by_key(5000);
+    for (int k = 0; k < per_thread; ++k) {
+        by_key[(k * 7) % 5000] = handles[0][k];
+    }
+    for (int t = 0; t < threads_count; ++t) {
+        for (int k = 0; k < per_thread; ++k) {
+            // The same value interned by different threads gets one handle.
+            assert(handles[t][k] == by_key[(k * 7 + t * 13) % 5000]);
+        }
+    }
+}
+
+
+void TestBulkOperations() {
+
+    using V = Variant<int64_t, double, std::string>;
+
+    std::vector<double> doubles = {0.5, 1.5, 2.5, 3.5, 4.5};
+    std::allocator<V> alloc;
+    V* raw = alloc.allocate(doubles.size());
+    uninitialized_construct_n(raw, doubles.data(), doubles.size());
+    for (size_t k = 0; k < doubles.size(); ++k) {
+        assert(holds_alternative<double>(raw[k]));
+        assert(!raw[k].valueless_by_exception());
+        assert(get<double>(raw[k]) == doubles[k]);
+    }
+    for (size_t k = 0; k < doubles.size(); ++k) {
+        raw[k].~V();
+    }
+
+    std::vector<std::string> strings = {"a", "bb", std::string(100, 'c')};
+    uninitialized_construct_n(raw, strings.data(), strings.size());
+    assert(get<std::string>(raw[2]) == strings[2]);
+    for (size_t k = 0; k < strings.size(); ++k) {
+        raw[k].~V();
+    }
+    alloc.deallocate(raw, doubles.size());
+
+    std::vector<V> column(5);
+    column[1] = std::string(50, 'x');
+    column[3] = 7.0;
+    assign_n(column.data(), doubles.data(), doubles.size());
+    for (size_t k = 0; k < column.size(); ++k) {
+        assert(get<double>(column[k]) == doubles[k]);
+    }
+
+    column[2] = "abc";
+    assign_n(column.data() + 1, strings.data(), strings.size());
+    assert(get<double>(column[0]) == 0.5);
+    assert(get<std::string>(column[1]) == "a");
+    assert(get<std::string>(column[2]) == "bb");
+    assert(get<std::string>(column[3]) == strings[2]);
+    assert(get<double>(column[4]) == 4.5);
+
+    fill_alternative(column.data(), column.size(), static_cast<int64_t>(9));
+    for (const auto& v : column) {
+        assert(get<int64_t>(v) == 9);
+    }
+
+    fill_alternative(column.data(), 2, std::string("filled"));
+    assert(get<std::string>(column[0]) == "filled");
+    assert(get<std::string>(column[1]) == "filled");
+    assert(get<int64_t>(column[2]) == 9);
+
+    // Long enough for the prefetching loop, with odd length and scattered
+    // elements holding other alternatives.
+    std::vector<double> many(301);
+    std::vector<V> long_column(many.size());
+    for (size_t k = 0; k < many.size(); ++k) {
+        many[k] = double(k) + 0.5;
+        if (k % 7 == 3) {
+            long_column[k] = std::string(40, 'y');
+        }
+        else if (k % 11 == 5) {
+            long_column[k] = 1.0;
+        }
+    }
+    assign_n(long_column.data(), many.data(), many.size());
+    for (size_t k = 0; k < many.size(); ++k) {
+        assert(get<double>(long_column[k]) == many[k]);
+    }
+
+    // Moved-from elements keep their index but are valueless; assigning
+    // over them has to make them hold a value again.
+    auto move_out_all = [](std::vector<V>& vs) {
+        for (auto& v : vs) {
+            V taken = std::move(v);
+            assert(v.valueless_by_exception());
+        }
+    };
+    for (size_t k = 0; k < long_column.size(); ++k) {
+        if (k % 2 == 1) {
+            long_column[k] = std::string(40, 'z');
+        }
+    }
+    move_out_all(long_column);
+    assign_n(long_column.data(), many.data(), many.size());
+    for (size_t k = 0; k < many.size(); ++k) {
+        assert(!long_column[k].valueless_by_exception());
+        assert(get<double>(long_column[k]) == many[k]);
+    }
+
+    move_out_all(long_column);
+    fill_alternative(long_column.data(), long_column.size(), 2.0);
+    for (const auto& v : long_column) {
+        assert(!v.valueless_by_exception());
+        assert(get<double>(v) == 2.0);
+    }
+
+    fill_alternative(long_column.data(), long_column.size(), std::string("s"));
+    move_out_all(long_column);
+    fill_alternative(long_column.data(), long_column.size(), std::string("t"));
+    for (const auto& v : long_column) {
+        assert(!v.valueless_by_exception());
+        assert(get<std::string>(v) == "t");
+    }
+
+    move_out_all(long_column);
+    assign_n(long_column.data(), many.data(), many.size());
+    for (size_t k = 0; k < many.size(); ++k) {
+        assert(!long_column[k].valueless_by_exception());
+        assert(get<double>(long_column[k]) == many[k]);
+    }
+}
+
 
 int main() {
 
@@ -230,6 +883,36 @@ int main() {
     TestVariantWithConstType();
     std::cerr << "Test 4 (const types) passed." << std::endl;
 
+    TestMailbox();
+    std::cerr << "Test 5 (mailbox) passed." << std::endl;
+
+    TestMailboxConcurrent();
+    std::cerr << "Test 6 (mailbox, concurrent producers) passed." << std::endl;
+
+    TestHintedVisit();
+    std::cerr << "Test 7 (hinted visit) passed." << std::endl;
+
+    TestCodecRoundTrip();
+    std::cerr << "Test 8 (codec round trip) passed." << std::endl;
+
+    TestCodecBorrowed();
+    std::cerr << "Test 9 (codec, borrowed views) passed." << std::endl;
+
+    TestCodecRejectsOversizedRecords();
+    std::cerr << "Test 10 (codec, oversized records) passed." << std::endl;
+
+    TestPackedVariant();
+    std::cerr << "Test 11 (packed variant) passed." << std::endl;
+
+    TestInterner();
+    std::cerr << "Test 12 (interner) passed." << std::endl;
+
+    TestInternerConcurrent();
+    std::cerr << "Test 13 (interner, concurrent insertion) passed." << std::endl;
+
+    TestBulkOperations();
+    std::cerr << "Test 14 (bulk construct and assign) passed." << std::endl;
+
     std::cerr << "Here should appear more tests later..." << std::endl;
     
     //TestValuelessByException();